@@ -0,0 +1,93 @@
+/***
+ * Author:  Mike Williams
+ ***/
+
+/*** INCLUDES ***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*** MACROS ***/
+
+#define BUFFER_SIZE 128
+#define NAME "mosh-client"
+
+/*** MAIN FUNCTION ***/
+
+/** main - send one command line to a mosh server and exit with its status
+ **/
+int main(int argc, char** arg) {
+  struct sockaddr_un address;
+  char line[BUFFER_SIZE];
+  int fd_server;
+  int status;
+  int i;
+
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s SOCKET command [args...]\n", NAME);
+    return 2;
+  }
+  if (strlen(arg[1]) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "%s: Socket path too long.\n", NAME);
+    return 2;
+  }
+
+  // piece together command line from arguments, the server refuses lines of BUFFER_SIZE bytes or more
+  line[0] = 0;
+  for (i = 2; i < argc; i++) {
+    if (strlen(line)+strlen(arg[i])+2 > BUFFER_SIZE) {
+      fprintf(stderr, "%s: Command too long.\n", NAME);
+      return 2;
+    }
+    strcat(line, arg[i]);
+    strcat(line, i+1 < argc ? " " : "");
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, arg[1]);
+  fd_server = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (fd_server == -1 ||
+      connect(fd_server, (struct sockaddr*)&address, sizeof(address)) == -1) {
+    perror(arg[1]);
+    return 2;
+  }
+
+  // hand our stdin, stdout and stderr to the server along with the command
+  int fds[3] = {0, 1, 2};
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec data = { line, strlen(line) };
+  struct msghdr message;
+  struct cmsghdr* header;
+
+  memset(&message, 0, sizeof(message));
+  memset(control, 0, sizeof(control));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+  if (sendmsg(fd_server, &message, 0) == -1) {
+    perror(NAME);
+    return 2;
+  }
+
+  // output arrives directly on our fds, only the exit status comes back
+  if (recv(fd_server, &status, sizeof(int), 0) != sizeof(int)) {
+    fprintf(stderr, "%s: Server closed connection.\n", NAME);
+    return 2;
+  }
+  close(fd_server);
+
+  return status;
+}
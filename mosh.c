@@ -4,6 +4,8 @@
 
 /*** INCLUDES ***/
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,15 +13,34 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include <ctype.h>
 #include <time.h>
+#include <math.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 /*** MACROS ***/
 
 #define TIME_BUFFER_SIZE 7
 #define HISTORY_GROWTH_SIZE 15
 #define BUFFER_SIZE 128
+#define PROC_BUFFER_SIZE 4096
+#define JOBSTAT_INTERVAL 1.0
+#define PATH_CACHE_SIZE 64
+#define SERVE_MAX_EVENTS 64
+#define ALIAS_TABLE_SIZE 64
+#define FUNCTION_TABLE_SIZE 64
+#define FUNCTION_MAX_DEPTH 64
+#define BENCH_RUNS 10
+#define BENCH_WARMUPS 1
 #define PATH_DELIM ":"
 #define COMMAND_DELIM " "
 #define BEGIN_SLOT 0
@@ -31,15 +52,152 @@
 #define ECHO_COMMAND "echo"
 #define WHICH_COMMAND "which"
 #define VIEWPROC_COMMAND "viewproc"
+#define JOBSTAT_COMMAND "jobstat"
+#define BENCH_COMMAND "bench"
+#define ALIAS_COMMAND "alias"
+#define FUNCTION_KEYWORD "function"
+#define FOR_KEYWORD "for"
+#define WHILE_KEYWORD "while"
 #define EXIT_COMMAND "exit"
 
+#define REPLAY_OPTION "--replay"
+#define REPEAT_OPTION "--repeat"
+#define SERVE_OPTION "--serve"
+
+#define SLOT_LITERAL 0
+#define SLOT_ALL -1
+#define SLOT_VARIABLE -2
+#define SLOT_HOME -3
+
+#define FOR_LOOP 0
+#define WHILE_LOOP 1
+
+/*** STRUCTURES ***/
+
+// built-in running on a worker thread as part of a pipeline
+struct builtin_job {
+  int command_num;
+  FILE* out;
+  pthread_t thread;
+};
+
+// open /proc files and last counters of a job watched by jobstat
+struct job_sample {
+  int hist_index;
+  int fd_stat;
+  int fd_status;
+  int fd_io;
+  unsigned long long cpu_ticks;
+  unsigned long long read_bytes;
+  unsigned long long write_bytes;
+  long rss_kb;
+};
+
+// latency samples of one command line run by replay
+struct replay_line {
+  char* command;
+  double* latency;
+  int num_samples;
+};
+
+// cached PATH lookup of a command name
+struct path_entry {
+  char* name;
+  char* path;
+  struct path_entry* next;
+};
+
+// connection to a client of the command server
+struct client {
+  int fd;
+  pid_t pid;
+  int hist_index;
+};
+
+// alias from a name to the words replacing it
+struct alias {
+  char* name;
+  char** words;
+  struct alias* next;
+};
+
+// piece of a stored word, literal text or a slot filled in when run:
+// SLOT_LITERAL, positional parameter 1-9, SLOT_ALL, SLOT_VARIABLE or SLOT_HOME
+struct word_part {
+  int slot;
+  char* text;
+};
+
+// stored word split into parts
+struct word {
+  struct word_part* parts;
+  int num_parts;
+};
+
+// stored command of a pipeline
+struct compiled_stage {
+  struct word* words;
+  int num_words;
+};
+
+// stored pipeline and the buffers its expansions are written into
+struct compiled_pipeline {
+  struct compiled_stage* stages;
+  int num_stages;
+  char redirect_direction;
+  struct word redirect_file;
+  int background;
+
+  char** command;
+  char*** command_args;
+  char* redirect;
+  char** words;
+  int words_capacity;
+  char* text;
+  size_t text_capacity;
+  int in_use;
+};
+
+// pipelines parsed once from a function body
+struct compiled_body {
+  struct compiled_pipeline* pipelines;
+  int num_pipelines;
+};
+
+// shell function defined with "function name { ... }"
+struct function {
+  char* name;
+  struct compiled_body* body;
+  struct function* next;
+};
+
+// loop parsed once from "for name in words ; do ... ; done" or "while cmd ; do ... ; done"
+struct loop {
+  int type;
+  char* variable;
+  struct word* items;
+  int num_items;
+  struct compiled_body* condition;
+  struct compiled_body* body;
+};
+
 /*** VARIABLES ***/
 
 char* USER;
 char* HOME;
 char** PATH;
+struct path_entry* path_cache[PATH_CACHE_SIZE];
+struct alias* alias_table[ALIAS_TABLE_SIZE];
+struct function* function_table[FUNCTION_TABLE_SIZE];
+int function_depth;
+
+// loop waiting to run and the variable it sets on each pass
+struct loop* current_loop;
+char* loop_variable;
+char* loop_value;
 char* cwd;
 char* buffer;
+FILE* input_stream;
 char** command;
 char*** command_args;
 int num_commands;
@@ -49,11 +207,18 @@ int stay_alive;
 int num_paths;
 int num_children;
 int iter_status;
+sigset_t sigchld_mask;
+sigset_t child_mask;
 
 char* redirect;
 
 int keep_input;
 int keep_output;
+int keep_error;
+
+// clients connected to the command server
+struct client** clients;
+int num_clients;
 
 // storage for history
 char* time_buffer;
@@ -72,28 +237,101 @@ int* hist_state;
 
 void init_env();
 void prompt();
-void read_input();
+void check_jobs();
+int read_input();
+void run_input();
 void clear_buffer();
 void execute(int background);
-void execute_command(int command_num, int fd_in, int fd_out);
-
-void viewproc(char* proc_file);
-void history();
+pid_t run_pipeline(int background, int* status);
+pid_t execute_command(int command_num, int fd_in, int fd_out, int fd_next, struct builtin_job* jobs);
+void execute_builtin(int command_num, FILE* out);
+void* builtin_thread(void* job);
+int is_builtin(char* name);
+char* find_executable(char* name);
+void redirect_stdio(int fd_in, int fd_out);
+unsigned int hash_string(char* string);
+
+void viewproc(char* proc_file, FILE* out);
+void history(FILE* out);
+void jobstat(char** input, FILE* out);
+int open_job(struct job_sample* job, int hist_index);
+int sample_job(struct job_sample* job);
+void close_job(struct job_sample* job);
+void bench(char** input, FILE* out);
+void json_string(char* string, FILE* out);
+void alias(char** input, FILE* out);
+struct alias* find_alias(char* name);
+void expand_alias(int command_num);
+void define_function(char* definition);
+struct function* find_function(char* name);
+int run_function(struct function* function, char** params);
+struct compiled_body* compile_body(char* text);
+void add_stage(struct compiled_pipeline* pipeline);
+void compile_word(struct word* word, char* text);
+void add_part(struct word* word, int slot, char* text, int length);
+int run_body(struct compiled_body* body, char** params);
+int expand_pipeline(struct compiled_pipeline* pipeline, char** params);
+int expand_word(struct word* word, char** params, char* dest);
+char* lookup_variable(char* name);
+void free_body(struct compiled_body* body);
+void free_buffers(struct compiled_pipeline* pipeline);
+int compile_loop(char* text);
+void execute_loop();
+void free_loop(struct loop* loop);
 void extend_log();
-void echo(char** input);
+void echo(char** input, FILE* out);
 void cd(char** input);
-void which(char** input, int list_all);
+void which(char** input, int list_all, FILE* out);
 void swap_home(char** string);
 int num_args(char** arguments);
 int expand_env(int command_num, int index);
 void set_time(int time_slot, int index);
 void kill_child();
 
+int replay(char* replay_file, int repeat);
+void strip_history(char* line);
+double percentile(double* samples, int num_samples, double p);
+int compare_double(const void* a, const void* b);
+
+int serve(char* socket_path);
+int serve_request(struct client* client);
+void close_rights(struct msghdr* message);
+int serve_blocks();
+pid_t serve_spawn();
+void serve_reap();
+void close_client(struct client* client);
+
 /*** MAIN FUNCTION ***/
 
 int main(int argc, char** arg) {
+  char* replay_file = NULL;
+  char* socket_path = NULL;
+  int repeat = 1;
+  int i;
+
+  // check for command line options
+  for (i = 1; i < argc; i++) {
+    if (strcmp(arg[i], REPLAY_OPTION) == 0 && i+1 < argc) {
+      replay_file = arg[++i];
+    } else if (strcmp(arg[i], REPEAT_OPTION) == 0 && i+1 < argc && atoi(arg[i+1]) > 0) {
+      repeat = atoi(arg[++i]);
+    } else if (strcmp(arg[i], SERVE_OPTION) == 0 && i+1 < argc) {
+      socket_path = arg[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [%s FILE [%s N] | %s SOCKET]\n", NAME, REPLAY_OPTION, REPEAT_OPTION, SERVE_OPTION);
+      return 1;
+    }
+  }
+
   init_env();
 
+  if (replay_file != NULL) {
+    return replay(replay_file, repeat);
+  }
+  if (socket_path != NULL) {
+    return serve(socket_path);
+  }
+
   while (stay_alive == 1) {
     clear_buffer();
     prompt();
@@ -101,12 +339,7 @@ int main(int argc, char** arg) {
     if (strlen(buffer) == 0) {
       continue;
     }
-
-    switch(iter_status) {
-      case 0: execute(0); break;
-      case 2: execute(1); break;
-      default: set_time(END_SLOT, hist_log_size-1);
-    }
+    run_input();
   }
 
   return 0;
@@ -121,15 +354,16 @@ void init_env() {
   HOME = getenv("HOME");
 
   // break up individual paths from PATH variable
+  char* path_list = strdup(getenv("PATH"));
   char* token;
   int num_paths = 0;
-  for (token = strtok(getenv("PATH"), PATH_DELIM);
+  for (token = strtok(path_list, PATH_DELIM);
        token != NULL;
        token = strtok(NULL, PATH_DELIM)) {
     PATH = (char**)realloc(PATH, (++num_paths+1)*sizeof(char*));
     PATH[num_paths-1] = strdup(token);
   }
-  free(token);
+  free(path_list);
 
   // add NULL to end of PATH array
   PATH = (char**)realloc(PATH, (++num_paths+1)*sizeof(char*));
@@ -137,6 +371,7 @@ void init_env() {
 
   cwd = NULL;
   buffer = NULL;
+  input_stream = stdin;
 
   // initialize command
   command = (char**)malloc(sizeof(char*));
@@ -158,6 +393,7 @@ void init_env() {
   // store default stdin/stdout
   keep_input = dup(0);
   keep_output = dup(1);
+  keep_error = dup(2);
 
   // initialize history
   hist_log_size = 0;
@@ -170,7 +406,13 @@ void init_env() {
   hist_state = (int*)malloc(HISTORY_GROWTH_SIZE*sizeof(int));
 
   // tell parent to send completed children to the kill_child() function
+  sigemptyset(&sigchld_mask);
+  sigaddset(&sigchld_mask, SIGCHLD);
+  sigemptyset(&child_mask);
   signal(SIGCHLD, &kill_child);
+
+  // a built-in thread writing to a closed pipe must not kill the shell
+  signal(SIGPIPE, SIG_IGN);
 }
 
 /** prompt - display shell prompt
@@ -199,40 +441,48 @@ void prompt() {
     cwd[0] = '~';
     cwd[1] = 0;
     strcat(cwd,extra);
+    free(old_cwd);
   }
 
-  // check for completed background jobs
-  if (hist_log_size != 0) {
-    for (i = 0; i < hist_log_size; i++) {
-      if (hist_status[i] == 'R') {
-        // create PID file string
-        char* proc_status = (char*)malloc(20*sizeof(char));
-        char pid_string[6];
-        sprintf(pid_string, "%d", hist_pid[i]);
-        strcpy(proc_status, "/proc/");
-        strcat(proc_status, pid_string);
-        strcat(proc_status, "/status");
-
-        // check status of PID file
-        if (access(proc_status,F_OK)) {
-          hist_end_time[i] = (char*)malloc(TIME_BUFFER_SIZE*sizeof(char));
-          set_time(END_SLOT, i);
-        }
-        free(proc_status);
-      }
-    }
-  }
+  check_jobs();
 
   // informative prompt
   printf("[%s] %s %% ", cwd, USER);
 }
 
-/** read_input - read input to buffer and parse arguments
+/** check_jobs - check for completed background jobs
+ **/
+void check_jobs() {
+  int i;
+
+  for (i = 0; i < hist_log_size; i++) {
+    if (hist_status[i] == 'R') {
+      // create PID file string
+      char proc_status[32];
+      sprintf(proc_status, "/proc/%d/status", hist_pid[i]);
+
+      // check status of PID file
+      if (access(proc_status,F_OK)) {
+        set_time(END_SLOT, i);
+      }
+    }
+  }
+}
+
+/** read_input - read input to buffer and parse arguments, return 0 at end of input
  **/
-void read_input() {
+int read_input() {
   iter_status = 0;
   buffer = (char*)malloc((BUFFER_SIZE+1)*sizeof(char));
-  fgets(buffer, BUFFER_SIZE, stdin);
+  if (fgets(buffer, BUFFER_SIZE, input_stream) == NULL) {
+    // end of input closes an interactive shell
+    buffer[0] = 0;
+    if (input_stream == stdin) {
+      printf("\n");
+      stay_alive = 0;
+    }
+    return 0;
+  }
 
   // remove tail newline/return
   int i;
@@ -242,13 +492,33 @@ void read_input() {
     }
   }
 
+  // replayed input may be copied from history output
+  if (input_stream != stdin) {
+    strip_history(buffer);
+  }
+
+  // function bodies are stored unexpanded, so define them before parsing
+  if (strncmp(buffer, FUNCTION_KEYWORD " ", strlen(FUNCTION_KEYWORD)+1) == 0) {
+    define_function(buffer+strlen(FUNCTION_KEYWORD)+1);
+    buffer[0] = 0;
+    return 1;
+  }
+
   // check for log capacity limit
   if (hist_log_capacity - hist_log_size < 2) {
     extend_log();
   }
 
+  // loops are compiled whole so their bodies are parsed only once
+  if (strncmp(buffer, FOR_KEYWORD " ", strlen(FOR_KEYWORD)+1) == 0 ||
+      strncmp(buffer, WHILE_KEYWORD " ", strlen(WHILE_KEYWORD)+1) == 0) {
+    iter_status = compile_loop(buffer) == 0 ? 3 : 1;
+    return 1;
+  }
+
+  char* line = strdup(buffer);
   char* token;
-  for (i = 0, token = strtok(strdup(buffer), COMMAND_DELIM);
+  for (i = 0, token = strtok(line, COMMAND_DELIM);
        token != NULL && iter_status == 0;
        token = strtok(NULL, COMMAND_DELIM), i++) {
     // first token is command
@@ -263,7 +533,7 @@ void read_input() {
                (i > 1 && strcmp(command_args[num_commands-1][i-2], "&") == 0)) {
       fprintf(stderr, "%s: Misplaced & (argument %d).\n", NAME, i-1);
       iter_status = 1;
-    } else if (num_commands > 1 &&
+    } else if (num_commands > 1 && num_args(command_args[num_commands-2]) > 0 &&
               (i > 1 && strcmp(command_args[num_commands-2][num_args(command_args[num_commands-2])-1], "&") == 0)) {
       fprintf(stderr, "%s: Misplaced & (command %d).\n", NAME, num_commands-1);
       iter_status = 1;
@@ -310,6 +580,7 @@ void read_input() {
 
       redirect = (char*)realloc(redirect,(strlen(token)+2)*sizeof(char));
       redirect[0] = direction;
+      redirect[1] = 0;
       strcat(redirect,token);
 
       // set i back to account for redirection flag
@@ -327,14 +598,12 @@ void read_input() {
       iter_status = expand_env(num_commands-1, i-1);
     }
   }
-  if (iter_status == 0) {
-    free(token);
-  }
+  free(line);
 
   // check for no input
   if (i == 0 && num_commands == 0) {
     buffer[0] = 0;
-    return;
+    return 1;
   }
 
   if (iter_status == 0 && i > 1 &&
@@ -343,6 +612,37 @@ void read_input() {
     free(command_args[num_commands-1][i-2]);
     command_args[num_commands-1][i-2] = NULL;
   }
+
+  // check components of command for aliases and ~ to replace
+  int command_num;
+  for (command_num = 0; command_num < num_commands && iter_status != 1; command_num++) {
+    expand_alias(command_num);
+
+    // check command
+    if (command[command_num][0] == '~') {
+      swap_home(&command[command_num]);
+    }
+
+    // check arguments
+    for (i = 0; command_args[command_num][i] != NULL; i++) {
+      if (command_args[command_num][i][0] == '~') {
+        swap_home(&command_args[command_num][i]);
+      }
+    }
+  }
+
+  return 1;
+}
+
+/** run_input - execute parsed input according to its status
+ **/
+void run_input() {
+  switch(iter_status) {
+    case 0: execute(0); break;
+    case 2: execute(1); break;
+    case 3: execute_loop(); break;
+    default: if (hist_log_size > 0) set_time(END_SLOT, hist_log_size-1);
+  }
 }
 
 /** clear_buffer - free up memory taken by buffer, command, and command_args
@@ -360,9 +660,15 @@ void clear_buffer() {
       free(command_args[j][i]);
       command_args[j][i] = NULL;
     }
+    free(command_args[j]);
+  }
+  if (num_commands == 0) {
+    free(command_args[0]);
   }
   num_commands = 0;
 
+  free(command);
+  free(command_args);
   command = (char**)malloc(sizeof(char*));
   command[0] = NULL;
 
@@ -379,9 +685,7 @@ void clear_buffer() {
  **/
 void execute(int background) {
   int command_num;
-  int fd_in = -1;
-  int fd_out;
-  int i;
+  int status;
 
   // check for exit
   for (command_num = 0; command_num < num_commands; command_num++) {
@@ -395,170 +699,377 @@ void execute(int background) {
   set_time(BEGIN_SLOT, hist_log_size);
   hist_command[hist_log_size] = strdup(buffer);
   hist_end_time[hist_log_size] = "--:--";
+  hist_pid[hist_log_size] = pid_self;
   hist_log_size++;
 
-  // check components of command for ~ to replace
-  for (command_num = 0; command_num < num_commands; command_num++) {
-    // check command
-    if (command[command_num][0] == '~') {
-      swap_home(&command[command_num]);
-    }
+  // record the final command as the pipeline's process
+  hist_pid[hist_log_size-1] = run_pipeline(background, &status);
+  hist_state[hist_log_size-1] = status;
+  if (background == 0 || hist_pid[hist_log_size-1] == pid_self) {
+    set_time(END_SLOT, hist_log_size-1);
+  }
+}
 
-    // check arguments
-    for (i = 0; command_args[command_num][i] != NULL; i++) {
-      if (command_args[command_num][i][0] == '~') {
-        swap_home(&command_args[command_num][i]);
+/** run_pipeline - run parsed commands and return pid of the final one
+ **/
+pid_t run_pipeline(int background, int* status) {
+  struct function* function = NULL;
+  int command_num;
+  int fd_in = -1;
+  int fd_out = -1;
+
+  *status = 0;
+
+  // run a lone built-in or function inside the shell itself so no process is needed
+  if (num_commands == 1 &&
+      (is_builtin(command[0]) || (function = find_function(command[0])) != NULL)) {
+    int fd_target = redirect[0] == '<' ? 0 : 1;
+    int fd_saved = -1;
+
+    if (redirect[0] != 0) {
+      int fd_redirect = redirect[0] == '<' ?
+        open(redirect+1, O_RDONLY|O_CLOEXEC) :
+        open(redirect+1, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+      if (fd_redirect == -1) {
+        perror(redirect+1);
+        *status = 1 << 8;
+        return pid_self;
       }
+      fflush(stdout);
+      fd_saved = fcntl(fd_target, F_DUPFD_CLOEXEC, 0);
+      dup2(fd_redirect, fd_target);
+      close(fd_redirect);
     }
-  }
 
-  // fork and execute
-  pid_t child_pid = fork();
-  if (child_pid != 0) {
-    hist_pid[hist_log_size-1] = child_pid;
-    if (background == 1) {
-      // don't wait for child to finish executing
-      waitpid(child_pid, &hist_state[hist_log_size-1], WNOHANG);
+    if (function != NULL) {
+      *status = run_function(function, command_args[0]);
     } else {
-      // wait for child's termination then set history end time
-      waitpid(child_pid, &hist_state[hist_log_size-1], 0);
-      set_time(END_SLOT, hist_log_size-1);
+      execute_builtin(0, stdout);
     }
-    return;
+
+    // return stdin/stdout to what they were
+    if (redirect[0] != 0) {
+      fflush(stdout);
+      dup2(fd_saved, fd_target);
+      close(fd_saved);
+    }
+    return pid_self;
   }
 
-  // iterate through each command
-  stay_alive = 0;
+  // hold off the SIGCHLD handler so it can't reap the pipeline from under us
+  sigset_t old_mask;
+  sigprocmask(SIG_BLOCK, &sigchld_mask, &old_mask);
+  fflush(stdout);
+
+  // spawn every command directly from the shell
+  pid_t* pids = (pid_t*)malloc(num_commands*sizeof(pid_t));
+  struct builtin_job* jobs = (struct builtin_job*)calloc(num_commands, sizeof(struct builtin_job));
+  for (command_num = 0; command_num < num_commands; command_num++) {
+    pids[command_num] = -1;
+  }
   for (command_num = 0; command_num < num_commands; command_num++) {
-    int fd_pipe[2];
+    int fd_pipe[2] = {-1, -1};
 
     // account for I/O redirection
-    if (redirect[0] != 0) {
-      char* redirect_file = redirect+1;
-      if (redirect[0] == '<') {
-        // set input fd to opened file
-        fd_in = open(redirect_file, O_RDONLY);
-      } else {
-        // set output fd to opened file
-        fd_out = open(redirect_file, O_RDWR|O_CREAT|O_TRUNC);
+    if (command_num == 0 && redirect[0] == '<') {
+      // set input fd of first command to opened file
+      if ((fd_in = open(redirect+1, O_RDONLY|O_CLOEXEC)) == -1) {
+        perror(redirect+1);
+        break;
       }
     }
 
     // set pipe for stdout if there is a next command
-    else if (command_num != num_commands-1) {
-      pipe(fd_pipe);
+    if (command_num != num_commands-1) {
+      if (pipe2(fd_pipe, O_CLOEXEC) == -1) {
+        perror(NAME);
+        if (fd_in != -1) {
+          close(fd_in);
+        }
+        break;
+      }
       fd_out = fd_pipe[1];
+    } else if (redirect[0] == '>') {
+      // set output fd of last command to opened file
+      if ((fd_out = open(redirect+1, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) == -1) {
+        perror(redirect+1);
+      }
     } else {
-      // return stdout fd to default
-      fd_out = keep_output;
+      // leave stdout as default
+      fd_out = -1;
     }
 
     // execute command with modified stdin/stdout
-    execute_command(command_num, fd_in, fd_out);
+    if (command_num != num_commands-1 || redirect[0] != '>' || fd_out != -1) {
+      pids[command_num] = execute_command(command_num, fd_in, fd_out, fd_pipe[0], jobs);
+    }
 
     // close fds to prevent any fd leaks
-    close(fd_in);
-    close(fd_out);
+    if (fd_in != -1) {
+      close(fd_in);
+    }
+    if (fd_out != -1) {
+      close(fd_out);
+    }
 
     // set stdin for next command
     fd_in = fd_pipe[0];
   }
+
+  // built-ins on worker threads must finish before the pipeline can
+  for (command_num = 0; command_num < num_commands; command_num++) {
+    if (jobs[command_num].out != NULL) {
+      pthread_join(jobs[command_num].thread, NULL);
+    }
+  }
+
+  // final command that never started still counts as a failure
+  pid_t pid = pids[num_commands-1] != -1 ? pids[num_commands-1] : pid_self;
+  *status = pids[num_commands-1] != -1 || is_builtin(command[num_commands-1]) ? 0 : 127 << 8;
+
+  // wait for each command's termination
+  for (command_num = 0; command_num < num_commands && background == 0; command_num++) {
+    if (pids[command_num] != -1) {
+      waitpid(pids[command_num], status, 0);
+    }
+  }
+
+  free(pids);
+  free(jobs);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  return pid;
 }
 
-/** execute_command - execute individual command
+/** execute_command - spawn individual command and return its pid
  **/
-void execute_command(int command_num, int fd_in, int fd_out) {
+pid_t execute_command(int command_num, int fd_in, int fd_out, int fd_next, struct builtin_job* jobs) {
+  struct builtin_job* job = &jobs[command_num];
+  pid_t pid;
   int i;
 
-  // change stdin if necessary
-  if (fd_in != -1 && fd_in != 0) {
-    dup2(fd_in,0);
-    close(fd_in);
+  // built-ins other than cd, alias and bench write to their end of the pipe from a thread
+  if (is_builtin(command[command_num]) && strcmp(command[command_num], CD_COMMAND) != 0 &&
+      strcmp(command[command_num], ALIAS_COMMAND) != 0 &&
+      strcmp(command[command_num], BENCH_COMMAND) != 0) {
+    job->command_num = command_num;
+    job->out = fdopen(fcntl(fd_out != -1 ? fd_out : 1, F_DUPFD_CLOEXEC, 0), "w");
+    if (job->out == NULL) {
+      perror(command[command_num]);
+    } else if ((errno = pthread_create(&job->thread, NULL, &builtin_thread, job)) != 0) {
+      perror(command[command_num]);
+      fclose(job->out);
+      job->out = NULL;
+    }
+    return -1;
   }
-  // change stdout if necessary
-  if (fd_out != -1 && fd_in != 1) {
-    dup2(fd_out,1);
-    close(fd_out);
+
+  // cd, bench and functions in a pipeline run in a plain copy of the shell so they can't move us,
+  // bench also masks signals and fills path_cache, which is only safe off the worker threads
+  struct function* function = find_function(command[command_num]);
+  if (function != NULL || is_builtin(command[command_num])) {
+    if ((pid = fork()) == 0) {
+      int status = 0;
+      sigprocmask(SIG_SETMASK, &child_mask, NULL);
+      if (fd_next != -1) {
+        close(fd_next);
+      }
+
+      // this copy never execs, so drop streams of earlier built-in threads or their readers never see EOF
+      for (i = 0; i < command_num; i++) {
+        if (jobs[i].out != NULL) {
+          close(fileno(jobs[i].out));
+        }
+      }
+      redirect_stdio(fd_in, fd_out);
+      if (function != NULL) {
+        status = run_function(function, command_args[command_num]);
+      } else {
+        execute_builtin(command_num, stdout);
+      }
+      fflush(stdout);
+      _exit(WEXITSTATUS(status));
+    }
+    return pid;
+  }
+
+  // check through PATH for executable
+  char* exec_path = find_executable(command[command_num]);
+  if (exec_path == NULL) {
+    return -1;
+  }
+
+  // build external command
+  int num_exec_args = num_args(command_args[command_num]);
+  char** exec_args = (char**)malloc((num_exec_args+2)*sizeof(char*));
+  exec_args[0] = exec_path;
+  memcpy(exec_args+1, command_args[command_num], (num_exec_args+1)*sizeof(char*));
+
+  // fork and exec directly, the child becomes the command itself
+  if ((pid = fork()) == 0) {
+    sigprocmask(SIG_SETMASK, &child_mask, NULL);
+    signal(SIGPIPE, SIG_DFL);
+    redirect_stdio(fd_in, fd_out);
+    execv(exec_path, exec_args);
+    perror(exec_path);
+    _exit(127);
   }
 
-  // check for built-ins
+  free(exec_args);
+  free(exec_path);
+  return pid;
+}
+
+/** execute_builtin - run built-in command in the current process
+ **/
+void execute_builtin(int command_num, FILE* out) {
   if (strcmp(command[command_num], CD_COMMAND) == 0) {
     cd(command_args[command_num]);
     return;
   }
   if (strcmp(command[command_num], HISTORY_COMMAND) == 0) {
-    history();
+    history(out);
     return;
   }
   if (strcmp(command[command_num], ECHO_COMMAND) == 0) {
-    echo(command_args[command_num]);
+    echo(command_args[command_num], out);
     return;
   }
   if (strcmp(command[command_num], WHICH_COMMAND) == 0) {
     if (command_args[command_num][0] == NULL) {
-      which(NULL,0);
+      which(NULL,0,out);
     } else {
-      which(command_args[command_num], strcmp(command_args[command_num][0], "-a") == 0 ? 1 : 0);
+      which(command_args[command_num], strcmp(command_args[command_num][0], "-a") == 0 ? 1 : 0, out);
     }
     return;
   }
+  if (strcmp(command[command_num], JOBSTAT_COMMAND) == 0) {
+    jobstat(command_args[command_num], out);
+    return;
+  }
+  if (strcmp(command[command_num], ALIAS_COMMAND) == 0) {
+    alias(command_args[command_num], out);
+    return;
+  }
+  if (strcmp(command[command_num], BENCH_COMMAND) == 0) {
+    bench(command_args[command_num], out);
+    return;
+  }
   if (strcmp(command[command_num], VIEWPROC_COMMAND) == 0) {
     if (num_args(command_args[command_num]) > 1) {
       fprintf(stderr, "%s: Too many arguments.\n", VIEWPROC_COMMAND);
     } else {
-      viewproc(command_args[command_num][0]);
+      viewproc(command_args[command_num][0], out);
     }
     return;
   }
+}
 
-  // build external command
-  int num_exec_args = num_args(command_args[command_num]);
-  command_args[command_num] = (char**)realloc(command_args[command_num], (num_exec_args+2)*sizeof(char*));
-  command_args[command_num][num_exec_args+1] = NULL;
-  for (i = num_args(command_args[command_num]); i > 0; i--) {
-      command_args[command_num][i] = strdup(command_args[command_num][i-1]);
-  }
-  command_args[command_num][0] = strdup(command[command_num]);
+/** builtin_thread - run built-in from a pipeline on a worker thread
+ **/
+void* builtin_thread(void* job) {
+  struct builtin_job* builtin = (struct builtin_job*)job;
 
-  // check through PATH for executable
+  // closing the stream sends EOF to the next command
+  execute_builtin(builtin->command_num, builtin->out);
+  fclose(builtin->out);
+  return NULL;
+}
+
+/** is_builtin - check if command is handled by the shell itself
+ **/
+int is_builtin(char* name) {
+  return strcmp(name, CD_COMMAND) == 0 ||
+         strcmp(name, HISTORY_COMMAND) == 0 ||
+         strcmp(name, ECHO_COMMAND) == 0 ||
+         strcmp(name, WHICH_COMMAND) == 0 ||
+         strcmp(name, VIEWPROC_COMMAND) == 0 ||
+         strcmp(name, JOBSTAT_COMMAND) == 0 ||
+         strcmp(name, BENCH_COMMAND) == 0 ||
+         strcmp(name, ALIAS_COMMAND) == 0;
+}
+
+/** find_executable - return full path of command or NULL if not runnable
+ **/
+char* find_executable(char* name) {
+  unsigned int bucket = hash_string(name) % PATH_CACHE_SIZE;
+  struct path_entry* entry;
   char* temp_path;
+  int i;
+
+  // reuse earlier PATH lookup while it still points at an executable
+  for (entry = path_cache[bucket]; entry != NULL; entry = entry->next) {
+    if (strcmp(entry->name, name) == 0) {
+      if (!access(entry->path, X_OK)) {
+        return strdup(entry->path);
+      }
+      break;
+    }
+  }
+
+  // check for executable in PATH
   for (i = 0; PATH[i] != NULL; i++) {
-    temp_path = (char*)malloc((strlen(command[command_num])+strlen(PATH[i])+1)*sizeof(char));
+    temp_path = (char*)malloc((strlen(name)+strlen(PATH[i])+2)*sizeof(char));
     strcpy(temp_path, PATH[i]);
     strcat(temp_path, "/");
-    strcat(temp_path, command[command_num]);
+    strcat(temp_path, name);
 
-    // check for executable in PATH
     if (!access(temp_path, X_OK)) {
-      command[command_num] = strdup(temp_path);
-      command_args[command_num][0] = strdup(temp_path);
-      free(temp_path);
-      break;
+      // remember where the command was found
+      if (entry == NULL) {
+        entry = (struct path_entry*)malloc(sizeof(struct path_entry));
+        entry->name = strdup(name);
+        entry->next = path_cache[bucket];
+        path_cache[bucket] = entry;
+      } else {
+        free(entry->path);
+      }
+      entry->path = strdup(temp_path);
+      return temp_path;
     }
     free(temp_path);
   }
 
-  // fork and execute
-  pid_t pid;
-  int status;
-  if (!access(command[command_num], F_OK)) {
-    if (!access(command[command_num], X_OK)) {
-      if ((pid = fork()) == 0) {
-        execv(command[command_num], command_args[command_num]);
-      } else {
-        waitpid(pid, &status, 0);
-      }
-    } else {
-      fprintf(stderr, "%s: Permission denied.\n", command[command_num]);
-    }
-  } else {
-    fprintf(stderr, "%s: Command not found.\n", command[command_num]);
+  // fall back to command as given
+  if (access(name, F_OK)) {
+    fprintf(stderr, "%s: Command not found.\n", name);
+    return NULL;
+  }
+  if (access(name, X_OK)) {
+    fprintf(stderr, "%s: Permission denied.\n", name);
+    return NULL;
+  }
+  return strdup(name);
+}
+
+/** hash_string - hash string for table lookups
+ **/
+unsigned int hash_string(char* string) {
+  unsigned int hash = 5381;
+
+  while (*string != 0) {
+    hash = hash*33 + (unsigned char)*string++;
+  }
+  return hash;
+}
+
+/** redirect_stdio - move given fds onto stdin/stdout
+ **/
+void redirect_stdio(int fd_in, int fd_out) {
+  // change stdin if necessary
+  if (fd_in != -1 && fd_in != 0) {
+    dup2(fd_in,0);
+    close(fd_in);
+  }
+  // change stdout if necessary
+  if (fd_out != -1 && fd_out != 1) {
+    dup2(fd_out,1);
+    close(fd_out);
   }
 }
 
 /** viewproc - view information about the /proc filesystem
  **/
-void viewproc(char* proc_file) {
+void viewproc(char* proc_file, FILE* out) {
   if (proc_file == NULL) {
     fprintf(stderr, "%s: No file specified.\n", VIEWPROC_COMMAND);
     return;
@@ -579,7 +1090,7 @@ void viewproc(char* proc_file) {
       } else {
         char proc_buffer[BUFFER_SIZE];
         while (fgets(proc_buffer, BUFFER_SIZE, procfile) != NULL) {
-          printf("%s", proc_buffer);
+          fprintf(out, "%s", proc_buffer);
         }
         fclose(procfile);
       }
@@ -589,72 +1100,1184 @@ void viewproc(char* proc_file) {
   } else {
     fprintf(stderr, "%s: %s was not found in /proc.\n", VIEWPROC_COMMAND, proc_file);
   }
+  free(proc_abs_path);
 }
 
-/** history - show command history
+/** jobstat - sample resource usage of running background jobs
  **/
-void history() {
+void jobstat(char** input, FILE* out) {
+  double interval = JOBSTAT_INTERVAL;
+  struct timespec now, last;
+  int num_jobs = 0;
+  int num_running;
   int i;
-  printf(" PID   State  Begin   End    Command\n");
-  for (i = 0; i < hist_log_size-1; i++) {
-    printf("%d\t[%c]   %s  %s   %s\n", hist_pid[i], hist_status[i], hist_begin_time[i], hist_end_time[i], hist_command[i]);
-  }
-}
-
-/** extend_log - increase capacity for history log
- **/
-void extend_log() {
-  // expand history memory by predefined HISTORY_GROWTH_SIZE
-  hist_begin_time = (char**)realloc(hist_begin_time, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(char*));
-  hist_end_time = (char**)realloc(hist_end_time, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(char*));
-  hist_command = (char**)realloc(hist_command, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(char*));
-  hist_status = (char*)realloc(hist_status, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(char));
-  hist_pid = (pid_t*)realloc(hist_pid, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(pid_t));
-  hist_state = (int*)realloc(hist_state, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(int));
 
-  hist_log_capacity += HISTORY_GROWTH_SIZE;
-}
-
-/** echo - print out arguments to screen
- **/
-void echo(char** input) {
-  int i;
-  for (i = 0; input[i] != NULL; i++) {
-    printf("%s%s", input[i], input[i+1] != NULL ? " " : "\n");
+  // check for interval flag
+  if (num_args(input) > 0) {
+    if (strcmp(input[0], "-i") != 0 || num_args(input) != 2) {
+      fprintf(stderr, "%s: Usage: %s [-i interval].\n", JOBSTAT_COMMAND, JOBSTAT_COMMAND);
+      return;
+    }
+    interval = atof(input[1]);
+    if (interval <= 0) {
+      fprintf(stderr, "%s: Invalid interval %s.\n", JOBSTAT_COMMAND, input[1]);
+      return;
+    }
   }
-}
 
-/** cd - change current directory to new_dir
- **/
-void cd(char** input) {
-  // use HOME for no arguments
-  if (num_args(input) == 0) {
-    chdir(HOME);
-    return;
+  // open /proc files once for every running job
+  struct job_sample* jobs = (struct job_sample*)malloc((hist_log_size+1)*sizeof(struct job_sample));
+  for (i = 0; i < hist_log_size; i++) {
+    if (hist_status[i] != 'R' || hist_pid[i] == pid_self || hist_pid[i] <= 0) {
+      continue;
+    }
+    if (open_job(&jobs[num_jobs], i) == -1) {
+      continue;
+    }
+    if (sample_job(&jobs[num_jobs]) == -1) {
+      close_job(&jobs[num_jobs]);
+      continue;
+    }
+    num_jobs++;
   }
 
-  // check for bad syntax
-  if (num_args(input) > 1) {
-    fprintf(stderr, "%s: Too many arguments.\n", CD_COMMAND);
+  if (num_jobs == 0) {
+    fprintf(stderr, "%s: No running jobs.\n", JOBSTAT_COMMAND);
+    free(jobs);
     return;
   }
 
-  // replace leading ~ with HOME path
-  if (input[0][0] == '~') {
-    swap_home(&input[0]);
-  }
+  clock_gettime(CLOCK_MONOTONIC, &last);
+  do {
+    // sleep for interval, stopping early if enter is pressed
+    if (isatty(0)) {
+      struct pollfd key = { .fd = 0, .events = POLLIN };
+      char discard[BUFFER_SIZE];
+      if (poll(&key, 1, (int)(interval*1000)) > 0 && read(0, discard, BUFFER_SIZE) >= 0) {
+        break;
+      }
+    } else {
+      struct timespec pause = { (time_t)interval, (long)((interval-(time_t)interval)*1e9) };
+      nanosleep(&pause, NULL);
+    }
 
-  if (access(input[0], F_OK)) {
-    fprintf(stderr, "%s: %s: No such file or directory.\n", CD_COMMAND, input[0]);
-  } else if (chdir(input[0]) == -1 && errno == ENOTDIR) {
-    fprintf(stderr, "%s: %s: Not a directory.\n", CD_COMMAND, input[0]);
-    errno = 0;
-  }
-}
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec-last.tv_sec) + (now.tv_nsec-last.tv_nsec)/1e9;
+    last = now;
+
+    // redraw table from freshly sampled values
+    if (isatty(fileno(out))) {
+      fprintf(out, "\033[H\033[J");
+    }
+    fprintf(out, "%s: every %.1fs, press enter to stop\n", JOBSTAT_COMMAND, interval);
+    fprintf(out, " PID     CPU%%      RSS     Read/s    Write/s   Command\n");
+    for (i = 0, num_running = 0; i < num_jobs; i++) {
+      if (jobs[i].fd_stat == -1) {
+        continue;
+      }
+
+      unsigned long long cpu_ticks = jobs[i].cpu_ticks;
+      unsigned long long read_bytes = jobs[i].read_bytes;
+      unsigned long long write_bytes = jobs[i].write_bytes;
+      if (sample_job(&jobs[i]) == -1) {
+        close_job(&jobs[i]);
+        continue;
+      }
+      num_running++;
+
+      fprintf(out, "%-6d %6.1f %7ldK %9.0fK %9.0fK   %s\n",
+              hist_pid[jobs[i].hist_index],
+              100.0*(jobs[i].cpu_ticks-cpu_ticks)/sysconf(_SC_CLK_TCK)/elapsed,
+              jobs[i].rss_kb,
+              (jobs[i].read_bytes-read_bytes)/1024.0/elapsed,
+              (jobs[i].write_bytes-write_bytes)/1024.0/elapsed,
+              hist_command[jobs[i].hist_index]);
+    }
+    fflush(out);
+  } while (num_running > 0);
+
+  for (i = 0; i < num_jobs; i++) {
+    close_job(&jobs[i]);
+  }
+  free(jobs);
+}
+
+/** open_job - open /proc files used to sample a job
+ **/
+int open_job(struct job_sample* job, int hist_index) {
+  char proc_path[32];
+
+  job->hist_index = hist_index;
+  job->cpu_ticks = 0;
+  job->read_bytes = 0;
+  job->write_bytes = 0;
+  job->rss_kb = 0;
+
+  sprintf(proc_path, "/proc/%d/stat", hist_pid[hist_index]);
+  job->fd_stat = open(proc_path, O_RDONLY|O_CLOEXEC);
+  sprintf(proc_path, "/proc/%d/status", hist_pid[hist_index]);
+  job->fd_status = open(proc_path, O_RDONLY|O_CLOEXEC);
+
+  // I/O counters can be unreadable, leave rates at zero then
+  sprintf(proc_path, "/proc/%d/io", hist_pid[hist_index]);
+  job->fd_io = open(proc_path, O_RDONLY|O_CLOEXEC);
+
+  if (job->fd_stat == -1 || job->fd_status == -1) {
+    close_job(job);
+    return -1;
+  }
+  return 0;
+}
+
+/** sample_job - read current counters of a job without reopening files
+ **/
+int sample_job(struct job_sample* job) {
+  char proc_buffer[PROC_BUFFER_SIZE];
+  unsigned long utime, stime;
+  char state;
+  ssize_t length;
+  char* field;
+
+  // CPU time comes after the parenthesized command name in stat
+  if ((length = pread(job->fd_stat, proc_buffer, PROC_BUFFER_SIZE-1, 0)) <= 0) {
+    return -1;
+  }
+  proc_buffer[length] = 0;
+  if ((field = strrchr(proc_buffer, ')')) == NULL ||
+      sscanf(field+2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &state, &utime, &stime) != 3 || state == 'Z') {
+    return -1;
+  }
+  job->cpu_ticks = utime+stime;
+
+  if ((length = pread(job->fd_status, proc_buffer, PROC_BUFFER_SIZE-1, 0)) <= 0) {
+    return -1;
+  }
+  proc_buffer[length] = 0;
+  if ((field = strstr(proc_buffer, "VmRSS:")) != NULL) {
+    job->rss_kb = strtol(field+6, NULL, 10);
+  }
+
+  if (job->fd_io != -1 &&
+      (length = pread(job->fd_io, proc_buffer, PROC_BUFFER_SIZE-1, 0)) > 0) {
+    proc_buffer[length] = 0;
+    // storage counters, rchar and wchar would also count pipe and tty traffic
+    if ((field = strstr(proc_buffer, "\nread_bytes:")) != NULL) {
+      job->read_bytes = strtoull(field+12, NULL, 10);
+    }
+    if ((field = strstr(proc_buffer, "\nwrite_bytes:")) != NULL) {
+      job->write_bytes = strtoull(field+13, NULL, 10);
+    }
+  }
+  return 0;
+}
+
+/** close_job - close /proc files of a job
+ **/
+void close_job(struct job_sample* job) {
+  if (job->fd_stat != -1) {
+    close(job->fd_stat);
+  }
+  if (job->fd_status != -1) {
+    close(job->fd_status);
+  }
+  if (job->fd_io != -1) {
+    close(job->fd_io);
+  }
+  job->fd_stat = job->fd_status = job->fd_io = -1;
+}
+
+/** bench - measure repeated runs of an external command
+ **/
+void bench(char** input, FILE* out) {
+  int runs = BENCH_RUNS;
+  int warmups = BENCH_WARMUPS;
+  int json = 0;
+  int failures = 0;
+  int i;
+
+  // check for option flags before the command
+  for (i = 0; input[i] != NULL && input[i][0] == '-'; i++) {
+    if (strcmp(input[i], "-j") == 0) {
+      json = 1;
+    } else if (strcmp(input[i], "-n") == 0 && input[i+1] != NULL && atoi(input[i+1]) > 0) {
+      runs = atoi(input[++i]);
+    } else if (strcmp(input[i], "-w") == 0 && input[i+1] != NULL && atoi(input[i+1]) >= 0) {
+      warmups = atoi(input[++i]);
+    } else {
+      break;
+    }
+  }
+  if (input[i] == NULL || input[i][0] == '-') {
+    fprintf(stderr, "%s: Usage: %s [-n runs] [-w warmups] [-j] command [args...].\n", BENCH_COMMAND, BENCH_COMMAND);
+    return;
+  }
+
+  // resolve PATH and build arguments once for every run
+  char** bench_args = input+i;
+  char* exec_path = find_executable(bench_args[0]);
+  if (exec_path == NULL) {
+    return;
+  }
+  int num_exec_args = num_args(bench_args);
+  char** exec_args = (char**)malloc((num_exec_args+1)*sizeof(char*));
+  memcpy(exec_args, bench_args, (num_exec_args+1)*sizeof(char*));
+  exec_args[0] = exec_path;
+
+  int fd_null = open("/dev/null", O_WRONLY|O_CLOEXEC);
+  double* wall_ms = (double*)malloc(runs*sizeof(double));
+  double user_ms = 0;
+  double sys_ms = 0;
+
+  // keep the SIGCHLD handler from reaping runs before wait4 can
+  sigset_t old_mask;
+  sigprocmask(SIG_BLOCK, &sigchld_mask, &old_mask);
+  fflush(out);
+
+  for (i = -warmups; i < runs; i++) {
+    struct timespec begin, end;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if ((pid = fork()) == 0) {
+      sigprocmask(SIG_SETMASK, &child_mask, NULL);
+      signal(SIGPIPE, SIG_DFL);
+      redirect_stdio(-1, fd_null);
+      execv(exec_path, exec_args);
+      perror(exec_path);
+      _exit(127);
+    }
+    if (pid == -1 || wait4(pid, &status, 0, &usage) == -1) {
+      perror(BENCH_COMMAND);
+      break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // warmup runs are not measured
+    if (i < 0) {
+      continue;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      failures++;
+    }
+    wall_ms[i] = (end.tv_sec-begin.tv_sec)*1e3 + (end.tv_nsec-begin.tv_nsec)/1e6;
+    user_ms += usage.ru_utime.tv_sec*1e3 + usage.ru_utime.tv_usec/1e3;
+    sys_ms += usage.ru_stime.tv_sec*1e3 + usage.ru_stime.tv_usec/1e3;
+  }
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  close(fd_null);
+
+  if (i == runs) {
+    // mean and sample standard deviation of wall time
+    double mean = 0;
+    double variance = 0;
+    for (i = 0; i < runs; i++) {
+      mean += wall_ms[i];
+    }
+    mean /= runs;
+    for (i = 0; i < runs; i++) {
+      variance += (wall_ms[i]-mean)*(wall_ms[i]-mean);
+    }
+    double stddev = runs > 1 ? sqrt(variance/(runs-1)) : 0;
+    qsort(wall_ms, runs, sizeof(double), &compare_double);
+
+    if (json == 1) {
+      fprintf(out, "{\"command\": \"");
+      for (i = 0; bench_args[i] != NULL; i++) {
+        json_string(bench_args[i], out);
+        fprintf(out, "%s", bench_args[i+1] != NULL ? " " : "");
+      }
+      fprintf(out, "\", \"runs\": %d, \"warmups\": %d, \"failures\": %d, "
+              "\"wall_ms\": {\"mean\": %.4f, \"stddev\": %.4f, \"min\": %.4f, \"max\": %.4f, "
+              "\"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f}, "
+              "\"user_ms\": %.4f, \"sys_ms\": %.4f}\n",
+              runs, warmups, failures, mean, stddev, wall_ms[0], wall_ms[runs-1],
+              percentile(wall_ms, runs, 50), percentile(wall_ms, runs, 95), percentile(wall_ms, runs, 99),
+              user_ms/runs, sys_ms/runs);
+    } else {
+      fprintf(out, "%s: %d runs, %d warmups, %d failed\n", exec_path, runs, warmups, failures);
+      fprintf(out, "  wall  mean %.3f ms  stddev %.3f ms  min %.3f ms  max %.3f ms\n",
+              mean, stddev, wall_ms[0], wall_ms[runs-1]);
+      fprintf(out, "        p50 %.3f ms  p95 %.3f ms  p99 %.3f ms\n",
+              percentile(wall_ms, runs, 50), percentile(wall_ms, runs, 95), percentile(wall_ms, runs, 99));
+      fprintf(out, "  cpu   user %.3f ms  sys %.3f ms per run\n", user_ms/runs, sys_ms/runs);
+    }
+  }
+
+  free(wall_ms);
+  free(exec_args);
+  free(exec_path);
+}
+
+/** json_string - print string with JSON escapes
+ **/
+void json_string(char* string, FILE* out) {
+  for (; *string != 0; string++) {
+    if (*string == '"' || *string == '\\') {
+      fprintf(out, "\\%c", *string);
+    } else if ((unsigned char)*string < 0x20) {
+      fprintf(out, "\\u%04x", *string);
+    } else {
+      fputc(*string, out);
+    }
+  }
+}
+
+/** alias - define command alias or list all aliases
+ **/
+void alias(char** input, FILE* out) {
+  struct alias* entry;
+  int i, j;
+
+  // list aliases with no arguments
+  if (num_args(input) == 0) {
+    for (i = 0; i < ALIAS_TABLE_SIZE; i++) {
+      for (entry = alias_table[i]; entry != NULL; entry = entry->next) {
+        fprintf(out, "%s=", entry->name);
+        for (j = 0; entry->words[j] != NULL; j++) {
+          fprintf(out, "%s%s", entry->words[j], entry->words[j+1] != NULL ? " " : "\n");
+        }
+      }
+    }
+    return;
+  }
+
+  // alias name=command [args...]
+  char* value = strchr(input[0], '=');
+  if (value == NULL || value == input[0] || value[1] == 0) {
+    fprintf(stderr, "%s: Usage: %s name=command [args...].\n", ALIAS_COMMAND, ALIAS_COMMAND);
+    return;
+  }
+
+  char* name = strndup(input[0], value-input[0]);
+  unsigned int bucket = hash_string(name) % ALIAS_TABLE_SIZE;
+  for (entry = alias_table[bucket]; entry != NULL; entry = entry->next) {
+    if (strcmp(entry->name, name) == 0) {
+      break;
+    }
+  }
+
+  // replace words of an existing alias
+  if (entry == NULL) {
+    entry = (struct alias*)malloc(sizeof(struct alias));
+    entry->name = name;
+    entry->next = alias_table[bucket];
+    alias_table[bucket] = entry;
+  } else {
+    for (j = 0; entry->words[j] != NULL; j++) {
+      free(entry->words[j]);
+    }
+    free(entry->words);
+    free(name);
+  }
+
+  entry->words = (char**)malloc((num_args(input)+1)*sizeof(char*));
+  entry->words[0] = strdup(value+1);
+  for (j = 1; input[j] != NULL; j++) {
+    entry->words[j] = strdup(input[j]);
+  }
+  entry->words[j] = NULL;
+}
+
+/** find_alias - return alias of name or NULL
+ **/
+struct alias* find_alias(char* name) {
+  struct alias* entry;
+
+  for (entry = alias_table[hash_string(name) % ALIAS_TABLE_SIZE]; entry != NULL; entry = entry->next) {
+    if (strcmp(entry->name, name) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/** expand_alias - replace aliased command with its words
+ **/
+void expand_alias(int command_num) {
+  struct alias* entry = find_alias(command[command_num]);
+  if (entry == NULL) {
+    return;
+  }
+
+  // alias arguments come before the ones typed after it
+  int num_alias_args = num_args(entry->words)-1;
+  int num_typed_args = num_args(command_args[command_num]);
+  char** new_args = (char**)malloc((num_alias_args+num_typed_args+1)*sizeof(char*));
+  int i;
+
+  for (i = 0; i < num_alias_args; i++) {
+    new_args[i] = strdup(entry->words[i+1]);
+  }
+  memcpy(new_args+num_alias_args, command_args[command_num], (num_typed_args+1)*sizeof(char*));
+
+  free(command_args[command_num]);
+  command_args[command_num] = new_args;
+  free(command[command_num]);
+  command[command_num] = strdup(entry->words[0]);
+}
+
+/** define_function - compile and store "name { body }"
+ **/
+void define_function(char* definition) {
+  char* text = strdup(definition);
+  char* name = strtok(text, COMMAND_DELIM);
+  char* open_brace = name != NULL ? strtok(NULL, COMMAND_DELIM) : NULL;
+  char* body_text = open_brace != NULL ? open_brace+strlen(open_brace)+1 : NULL;
+  char* close_brace;
+
+  // find closing brace at end of the line
+  if (body_text != NULL && body_text > text+strlen(definition)) {
+    body_text = NULL;
+  }
+  if (body_text != NULL) {
+    for (close_brace = body_text+strlen(body_text)-1;
+         close_brace >= body_text && *close_brace == ' ';
+         close_brace--) {}
+    if (close_brace < body_text || *close_brace != '}') {
+      body_text = NULL;
+    } else {
+      *close_brace = 0;
+    }
+  }
+  if (body_text == NULL || strcmp(open_brace, "{") != 0) {
+    fprintf(stderr, "%s: Usage: %s name { command ; ... }.\n", FUNCTION_KEYWORD, FUNCTION_KEYWORD);
+    free(text);
+    return;
+  }
+
+  if (is_builtin(name) || strcmp(name, EXIT_COMMAND) == 0) {
+    fprintf(stderr, "%s: %s is a built-in command.\n", FUNCTION_KEYWORD, name);
+    free(text);
+    return;
+  }
+
+  struct compiled_body* body = compile_body(body_text);
+  if (body == NULL) {
+    free(text);
+    return;
+  }
+
+  // replace body of an existing function
+  struct function* function = find_function(name);
+  if (function == NULL) {
+    unsigned int bucket = hash_string(name) % FUNCTION_TABLE_SIZE;
+    function = (struct function*)malloc(sizeof(struct function));
+    function->name = strdup(name);
+    function->next = function_table[bucket];
+    function_table[bucket] = function;
+  } else {
+    free_body(function->body);
+  }
+  function->body = body;
+  free(text);
+}
+
+/** find_function - return function of name or NULL
+ **/
+struct function* find_function(char* name) {
+  struct function* function;
+
+  for (function = function_table[hash_string(name) % FUNCTION_TABLE_SIZE]; function != NULL; function = function->next) {
+    if (strcmp(function->name, name) == 0) {
+      return function;
+    }
+  }
+  return NULL;
+}
+
+/** run_function - run function body with arguments as positional parameters
+ **/
+int run_function(struct function* function, char** params) {
+  int status;
+
+  if (function_depth == FUNCTION_MAX_DEPTH) {
+    fprintf(stderr, "%s: Maximum function depth reached.\n", function->name);
+    return 1 << 8;
+  }
+
+  function_depth++;
+  status = run_body(function->body, params);
+  function_depth--;
+  return status == -1 ? 1 << 8 : status;
+}
+
+/** compile_body - parse ';' separated pipelines once into stored form
+ **/
+struct compiled_body* compile_body(char* text) {
+  struct compiled_body* body = (struct compiled_body*)calloc(1, sizeof(struct compiled_body));
+  struct compiled_pipeline* pipeline = NULL;
+  char* line = strdup(text);
+  char* token;
+  int end_pipeline;
+  int error = 0;
+
+  for (token = strtok(line, COMMAND_DELIM);
+       token != NULL && error == 0;
+       token = strtok(NULL, COMMAND_DELIM)) {
+    // a trailing ; ends the pipeline after this word
+    end_pipeline = token[strlen(token)-1] == ';';
+    if (end_pipeline) {
+      token[strlen(token)-1] = 0;
+    }
+
+    if (token[0] != 0) {
+      // start a new pipeline
+      if (pipeline == NULL) {
+        body->pipelines = (struct compiled_pipeline*)realloc(body->pipelines, (body->num_pipelines+1)*sizeof(struct compiled_pipeline));
+        pipeline = &body->pipelines[body->num_pipelines++];
+        memset(pipeline, 0, sizeof(struct compiled_pipeline));
+        add_stage(pipeline);
+      }
+
+      if (pipeline->background == 1) {
+        fprintf(stderr, "%s: Misplaced &.\n", NAME);
+        error = 1;
+      } else if (strcmp(token, "&") == 0) {
+        pipeline->background = 1;
+      } else if (strcmp(token, "|") == 0) {
+        if (pipeline->stages[pipeline->num_stages-1].num_words == 0) {
+          fprintf(stderr, "%s: Missing command before |.\n", NAME);
+          error = 1;
+        }
+        add_stage(pipeline);
+      } else if (strcmp(token, "<") == 0 || strcmp(token, ">") == 0) {
+        char direction = token[0];
+        if (pipeline->redirect_direction != 0) {
+          fprintf(stderr, "%s: Multiple I/O redirection arguments not supported.\n", NAME);
+          error = 1;
+        } else if (end_pipeline || (token = strtok(NULL, COMMAND_DELIM)) == NULL ||
+                   strcmp(token, ";") == 0) {
+          fprintf(stderr, "%s: No file specified after redirection.\n", NAME);
+          error = 1;
+        } else {
+          end_pipeline = token[strlen(token)-1] == ';';
+          if (end_pipeline) {
+            token[strlen(token)-1] = 0;
+          }
+          pipeline->redirect_direction = direction;
+          compile_word(&pipeline->redirect_file, token);
+        }
+      } else if (pipeline->stages[pipeline->num_stages-1].num_words == 0 &&
+                 (strcmp(token, FOR_KEYWORD) == 0 || strcmp(token, WHILE_KEYWORD) == 0 ||
+                  strcmp(token, FUNCTION_KEYWORD) == 0)) {
+        // loops and definitions are only read at the top level
+        fprintf(stderr, "%s: Nested %s not supported.\n", NAME, token);
+        error = 1;
+      } else {
+        struct compiled_stage* stage = &pipeline->stages[pipeline->num_stages-1];
+        struct alias* entry = stage->num_words == 0 ? find_alias(token) : NULL;
+
+        // an aliased command is stored as the alias's words, as typed lines are
+        if (entry != NULL) {
+          int k, num_alias_words = num_args(entry->words);
+          stage->words = (struct word*)realloc(stage->words, (stage->num_words+num_alias_words)*sizeof(struct word));
+          for (k = 0; k < num_alias_words; k++) {
+            compile_word(&stage->words[stage->num_words++], entry->words[k]);
+          }
+        } else {
+          stage->words = (struct word*)realloc(stage->words, (stage->num_words+1)*sizeof(struct word));
+          compile_word(&stage->words[stage->num_words++], token);
+        }
+      }
+    }
+
+    // check finished pipeline for an empty command
+    if (end_pipeline && pipeline != NULL && error == 0) {
+      if (pipeline->stages[pipeline->num_stages-1].num_words == 0) {
+        fprintf(stderr, "%s: Missing command after |.\n", NAME);
+        error = 1;
+      }
+      pipeline = NULL;
+    }
+  }
+  if (error == 0 && pipeline != NULL && pipeline->stages[pipeline->num_stages-1].num_words == 0) {
+    fprintf(stderr, "%s: Missing command after |.\n", NAME);
+    error = 1;
+  }
+  free(line);
+
+  if (error == 0 && body->num_pipelines == 0) {
+    fprintf(stderr, "%s: Empty command body.\n", NAME);
+    error = 1;
+  }
+  if (error == 1) {
+    free_body(body);
+    return NULL;
+  }
+  return body;
+}
+
+/** add_stage - add empty command to end of a stored pipeline
+ **/
+void add_stage(struct compiled_pipeline* pipeline) {
+  pipeline->stages = (struct compiled_stage*)realloc(pipeline->stages, (pipeline->num_stages+1)*sizeof(struct compiled_stage));
+  memset(&pipeline->stages[pipeline->num_stages++], 0, sizeof(struct compiled_stage));
+}
+
+/** compile_word - split word into literal text and $ slots
+ **/
+void compile_word(struct word* word, char* text) {
+  char* literal = text;
+  int i = 0;
+
+  word->parts = NULL;
+  word->num_parts = 0;
+
+  // leading ~ stands for HOME
+  if (text[0] == '~') {
+    add_part(word, SLOT_HOME, NULL, 0);
+    literal = text+1;
+    i = 1;
+  }
+
+  while (text[i] != 0) {
+    if (text[i] != '$') {
+      i++;
+      continue;
+    }
+
+    // close off literal text before the $
+    if (text+i > literal) {
+      add_part(word, SLOT_LITERAL, literal, text+i-literal);
+    }
+
+    if (isdigit(text[i+1]) && text[i+1] != '0') {
+      add_part(word, text[i+1]-'0', NULL, 0);
+      i += 2;
+    } else if (text[i+1] == '@') {
+      add_part(word, SLOT_ALL, NULL, 0);
+      i += 2;
+    } else if (isalpha(text[i+1]) || text[i+1] == '_') {
+      int length = 1;
+      while (isalnum(text[i+1+length]) || text[i+1+length] == '_') {
+        length++;
+      }
+      add_part(word, SLOT_VARIABLE, text+i+1, length);
+      i += length+1;
+    } else {
+      // leave a lone $ as it is
+      add_part(word, SLOT_LITERAL, "$", 1);
+      i++;
+    }
+    literal = text+i;
+  }
+
+  if (text+i > literal || word->num_parts == 0) {
+    add_part(word, SLOT_LITERAL, literal, text+i-literal);
+  }
+}
+
+/** add_part - append part to a stored word
+ **/
+void add_part(struct word* word, int slot, char* text, int length) {
+  word->parts = (struct word_part*)realloc(word->parts, (word->num_parts+1)*sizeof(struct word_part));
+  word->parts[word->num_parts].slot = slot;
+  word->parts[word->num_parts].text = text != NULL ? strndup(text, length) : NULL;
+  word->num_parts++;
+}
+
+/** run_body - expand and run each stored pipeline, return last status or -1 if expansion failed
+ **/
+int run_body(struct compiled_body* body, char** params) {
+  int status = 0;
+  int i, j;
+
+  for (i = 0; i < body->num_pipelines && stay_alive == 1 && status != -1; i++) {
+    struct compiled_pipeline* pipeline = &body->pipelines[i];
+    struct compiled_pipeline nested;
+
+    // a recursive call expands into its own buffers, the outer call still uses the stored ones
+    if (pipeline->in_use) {
+      nested = *pipeline;
+      nested.command = NULL;
+      nested.command_args = NULL;
+      nested.words = NULL;
+      nested.words_capacity = 0;
+      nested.text = NULL;
+      nested.text_capacity = 0;
+      pipeline = &nested;
+    }
+    pipeline->in_use = 1;
+
+    if (expand_pipeline(pipeline, params) == -1) {
+      status = -1;
+    }
+
+    // check for exit
+    for (j = 0; j < pipeline->num_stages && status != -1 && stay_alive == 1; j++) {
+      if (strcmp(pipeline->command[j], EXIT_COMMAND) == 0) {
+        stay_alive = 0;
+      }
+    }
+    if (status == -1 || stay_alive == 0) {
+      pipeline->in_use = 0;
+      if (pipeline == &nested) {
+        free_buffers(pipeline);
+      }
+      break;
+    }
+
+    // run expanded pipeline in place of the parsed input
+    char** keep_command = command;
+    char*** keep_command_args = command_args;
+    char* keep_redirect = redirect;
+    int keep_num_commands = num_commands;
+
+    command = pipeline->command;
+    command_args = pipeline->command_args;
+    redirect = pipeline->redirect;
+    num_commands = pipeline->num_stages;
+
+    run_pipeline(pipeline->background, &status);
+
+    command = keep_command;
+    command_args = keep_command_args;
+    redirect = keep_redirect;
+    num_commands = keep_num_commands;
+
+    pipeline->in_use = 0;
+    if (pipeline == &nested) {
+      free_buffers(pipeline);
+    }
+  }
+  return status;
+}
+
+/** expand_pipeline - fill pipeline's reused buffers with expanded words
+ **/
+int expand_pipeline(struct compiled_pipeline* pipeline, char** params) {
+  size_t text_size = 2;
+  int num_words = 0;
+  int length;
+  int i, j;
+
+  // measure expanded text so buffers grow at most once
+  for (i = 0; i < pipeline->num_stages; i++) {
+    for (j = 0; j < pipeline->stages[i].num_words; j++) {
+      struct word* word = &pipeline->stages[i].words[j];
+      if ((length = expand_word(word, params, NULL)) == -1) {
+        return -1;
+      }
+      text_size += length+1;
+      num_words += word->num_parts == 1 && word->parts[0].slot == SLOT_ALL ? num_args(params) : 1;
+    }
+    num_words++;
+  }
+  if (pipeline->redirect_direction != 0) {
+    if ((length = expand_word(&pipeline->redirect_file, params, NULL)) == -1) {
+      return -1;
+    }
+    text_size += length+1;
+  }
+
+  if (text_size > pipeline->text_capacity) {
+    pipeline->text = (char*)realloc(pipeline->text, text_size);
+    pipeline->text_capacity = text_size;
+  }
+  if (num_words > pipeline->words_capacity) {
+    pipeline->words = (char**)realloc(pipeline->words, num_words*sizeof(char*));
+    pipeline->words_capacity = num_words;
+  }
+  if (pipeline->command == NULL) {
+    pipeline->command = (char**)malloc((pipeline->num_stages+1)*sizeof(char*));
+    pipeline->command_args = (char***)malloc((pipeline->num_stages+1)*sizeof(char**));
+  }
+
+  // redirect takes the front of the text buffer
+  char* text = pipeline->text;
+  pipeline->redirect = text;
+  text[0] = pipeline->redirect_direction;
+  text[1] = 0;
+  if (pipeline->redirect_direction != 0) {
+    text += expand_word(&pipeline->redirect_file, params, text+1)+2;
+  } else {
+    text += 2;
+  }
+
+  // lay out each command as its words followed by NULL
+  char** words = pipeline->words;
+  for (i = 0; i < pipeline->num_stages; i++) {
+    char** stage_words = words;
+    for (j = 0; j < pipeline->stages[i].num_words; j++) {
+      struct word* word = &pipeline->stages[i].words[j];
+
+      // a lone $@ becomes one word per parameter
+      if (word->num_parts == 1 && word->parts[0].slot == SLOT_ALL) {
+        int k;
+        for (k = 0; params != NULL && params[k] != NULL; k++) {
+          strcpy(text, params[k]);
+          *words++ = text;
+          text += strlen(params[k])+1;
+        }
+        continue;
+      }
+      *words++ = text;
+      text += expand_word(word, params, text)+1;
+    }
+    *words++ = NULL;
+
+    // an empty $@ can leave nothing to run
+    if (stage_words[0] == NULL || stage_words[0][0] == 0) {
+      fprintf(stderr, "%s: Missing command.\n", NAME);
+      return -1;
+    }
+    pipeline->command[i] = stage_words[0];
+    pipeline->command_args[i] = stage_words+1;
+  }
+  return 0;
+}
+
+/** expand_word - write expanded word to dest and return its length
+ **/
+int expand_word(struct word* word, char** params, char* dest) {
+  int length = 0;
+  int i, j;
+
+  for (i = 0; i < word->num_parts; i++) {
+    struct word_part* part = &word->parts[i];
+    char* value = NULL;
+
+    if (part->slot == SLOT_LITERAL) {
+      value = part->text;
+    } else if (part->slot == SLOT_HOME) {
+      value = HOME;
+    } else if (part->slot == SLOT_VARIABLE) {
+      if ((value = lookup_variable(part->text)) == NULL) {
+        fprintf(stderr, "%s: Environment variable %s not found.\n", NAME, part->text);
+        return -1;
+      }
+    } else if (part->slot == SLOT_ALL) {
+      // $@ inside a longer word joins parameters with spaces
+      for (j = 0; params != NULL && params[j] != NULL; j++) {
+        if (dest != NULL) {
+          sprintf(dest+length, "%s%s", j > 0 ? " " : "", params[j]);
+        }
+        length += strlen(params[j])+(j > 0);
+      }
+      continue;
+    } else if (part->slot <= num_args(params)) {
+      value = params[part->slot-1];
+    }
+
+    if (value != NULL) {
+      if (dest != NULL) {
+        strcpy(dest+length, value);
+      }
+      length += strlen(value);
+    }
+  }
+  if (dest != NULL) {
+    dest[length] = 0;
+  }
+  return length;
+}
+
+/** lookup_variable - return value of variable name or NULL
+ **/
+char* lookup_variable(char* name) {
+  if (loop_variable != NULL && strcmp(name, loop_variable) == 0) {
+    return loop_value;
+  }
+  return getenv(name);
+}
+
+/** free_body - release stored body and its buffers
+ **/
+void free_body(struct compiled_body* body) {
+  int i, j, k, l;
+
+  for (i = 0; i < body->num_pipelines; i++) {
+    struct compiled_pipeline* pipeline = &body->pipelines[i];
+    for (j = 0; j < pipeline->num_stages; j++) {
+      for (k = 0; k < pipeline->stages[j].num_words; k++) {
+        for (l = 0; l < pipeline->stages[j].words[k].num_parts; l++) {
+          free(pipeline->stages[j].words[k].parts[l].text);
+        }
+        free(pipeline->stages[j].words[k].parts);
+      }
+      free(pipeline->stages[j].words);
+    }
+    for (l = 0; l < pipeline->redirect_file.num_parts; l++) {
+      free(pipeline->redirect_file.parts[l].text);
+    }
+    free(pipeline->redirect_file.parts);
+    free(pipeline->stages);
+    free_buffers(pipeline);
+  }
+  free(body->pipelines);
+  free(body);
+}
+
+/** free_buffers - release buffers a pipeline was expanded into
+ **/
+void free_buffers(struct compiled_pipeline* pipeline) {
+  free(pipeline->command);
+  free(pipeline->command_args);
+  free(pipeline->words);
+  free(pipeline->text);
+}
+
+/** compile_loop - parse for/while loop once into current_loop
+ **/
+int compile_loop(char* text) {
+  struct loop* loop = (struct loop*)calloc(1, sizeof(struct loop));
+  char* line = strdup(text);
+  char* token = strtok(line, COMMAND_DELIM);
+  char* do_token = NULL;
+  char* header = NULL;
+  char* body_text;
+  int end_header = 0;
+
+  loop->type = strcmp(token, FOR_KEYWORD) == 0 ? FOR_LOOP : WHILE_LOOP;
+
+  // for name in words... ;
+  if (loop->type == FOR_LOOP) {
+    token = strtok(NULL, COMMAND_DELIM);
+    if (token != NULL && strcmp(token, "in") != 0) {
+      loop->variable = strdup(token);
+      token = strtok(NULL, COMMAND_DELIM);
+    }
+    if (loop->variable == NULL || token == NULL || strcmp(token, "in") != 0) {
+      fprintf(stderr, "%s: Usage: %s name in words... ; do commands ; done.\n", FOR_KEYWORD, FOR_KEYWORD);
+      free(line);
+      free_loop(loop);
+      return -1;
+    }
+    while (end_header == 0 && (token = strtok(NULL, COMMAND_DELIM)) != NULL) {
+      end_header = token[strlen(token)-1] == ';';
+      if (end_header) {
+        token[strlen(token)-1] = 0;
+      }
+      if (token[0] != 0) {
+        loop->items = (struct word*)realloc(loop->items, (loop->num_items+1)*sizeof(struct word));
+        compile_word(&loop->items[loop->num_items++], token);
+      }
+    }
+  } else {
+    // while condition... ; compiled after the scan since compile_body uses strtok too
+    header = token+strlen(token)+1;
+    while (end_header == 0 && (token = strtok(NULL, COMMAND_DELIM)) != NULL) {
+      end_header = token[strlen(token)-1] == ';';
+    }
+    if (end_header == 1) {
+      token[strlen(token)-1] = 0;
+      header = strndup(text+(header-line), token+strlen(token)-header);
+    } else {
+      header = NULL;
+    }
+  }
+
+  // do commands... ; done
+  if (end_header == 1) {
+    do_token = strtok(NULL, COMMAND_DELIM);
+  }
+  if (loop->type == WHILE_LOOP) {
+    loop->condition = header != NULL ? compile_body(header) : NULL;
+    free(header);
+    if (loop->condition == NULL) {
+      fprintf(stderr, "%s: Usage: %s command ; do commands ; done.\n", WHILE_KEYWORD, WHILE_KEYWORD);
+      free(line);
+      free_loop(loop);
+      return -1;
+    }
+  }
+  if (do_token == NULL || strcmp(do_token, "do") != 0) {
+    fprintf(stderr, "%s: Missing do.\n", NAME);
+    free(line);
+    free_loop(loop);
+    return -1;
+  }
+
+  // body runs up to the final done
+  body_text = strdup(text+(do_token-line)+3 <= text+strlen(text) ? text+(do_token-line)+3 : "");
+  int length = strlen(body_text);
+  while (length > 0 && body_text[length-1] == ' ') {
+    body_text[--length] = 0;
+  }
+  if (length < 4 || strcmp(body_text+length-4, "done") != 0 ||
+      (length > 4 && body_text[length-5] != ' ' && body_text[length-5] != ';')) {
+    fprintf(stderr, "%s: Missing done.\n", NAME);
+    free(body_text);
+    free(line);
+    free_loop(loop);
+    return -1;
+  }
+  body_text[length-4] = 0;
+
+  loop->body = compile_body(body_text);
+  free(body_text);
+  free(line);
+  if (loop->body == NULL) {
+    free_loop(loop);
+    return -1;
+  }
+
+  current_loop = loop;
+  return 0;
+}
+
+/** execute_loop - run current_loop as a single history entry
+ **/
+void execute_loop() {
+  struct loop* loop = current_loop;
+  char** items = NULL;
+  int iterations = 0;
+  int status = 0;
+  int i;
+
+  // set history timestamp
+  set_time(BEGIN_SLOT, hist_log_size);
+  hist_end_time[hist_log_size] = "--:--";
+  hist_pid[hist_log_size] = pid_self;
+  hist_log_size++;
+
+  if (loop->type == FOR_LOOP) {
+    // expand item list once before the first pass
+    items = (char**)malloc((loop->num_items+1)*sizeof(char*));
+    for (i = 0; i < loop->num_items; i++) {
+      int length = expand_word(&loop->items[i], NULL, NULL);
+      if (length == -1) {
+        break;
+      }
+      items[i] = (char*)malloc(length+1);
+      expand_word(&loop->items[i], NULL, items[i]);
+    }
+    items[i] = NULL;
+    if (i < loop->num_items) {
+      status = -1;
+    }
+
+    // loop variable points at each item in turn, nothing is copied
+    loop_variable = loop->variable;
+    for (i = 0; items[i] != NULL && stay_alive == 1 && status != -1; i++, iterations++) {
+      loop_value = items[i];
+      status = run_body(loop->body, NULL);
+    }
+    loop_variable = NULL;
+  } else {
+    while (stay_alive == 1 && status != -1) {
+      status = run_body(loop->condition, NULL);
+      if (status == -1 || WEXITSTATUS(status) != 0) {
+        break;
+      }
+      status = run_body(loop->body, NULL);
+      iterations++;
+    }
+    if (status != -1) {
+      status = 0;
+    }
+  }
+
+  // summarize the whole loop in its history entry
+  char* summary = (char*)malloc(strlen(buffer)+32);
+  sprintf(summary, "%s [%d iterations]", buffer, iterations);
+  hist_command[hist_log_size-1] = summary;
+  hist_state[hist_log_size-1] = status == -1 ? 1 << 8 : status;
+  set_time(END_SLOT, hist_log_size-1);
+
+  if (items != NULL) {
+    for (i = 0; items[i] != NULL; i++) {
+      free(items[i]);
+    }
+    free(items);
+  }
+  free_loop(loop);
+  current_loop = NULL;
+}
+
+/** free_loop - release stored loop
+ **/
+void free_loop(struct loop* loop) {
+  int i, j;
+
+  for (i = 0; i < loop->num_items; i++) {
+    for (j = 0; j < loop->items[i].num_parts; j++) {
+      free(loop->items[i].parts[j].text);
+    }
+    free(loop->items[i].parts);
+  }
+  free(loop->items);
+  free(loop->variable);
+  if (loop->condition != NULL) {
+    free_body(loop->condition);
+  }
+  if (loop->body != NULL) {
+    free_body(loop->body);
+  }
+  free(loop);
+}
+
+/** history - show command history
+ **/
+void history(FILE* out) {
+  int i;
+  fprintf(out, " PID   State  Begin   End    Command\n");
+  for (i = 0; i < hist_log_size-1; i++) {
+    fprintf(out, "%d\t[%c]   %s  %s   %s\n", hist_pid[i], hist_status[i], hist_begin_time[i], hist_end_time[i], hist_command[i]);
+  }
+}
+
+/** extend_log - increase capacity for history log
+ **/
+void extend_log() {
+  // expand history memory by predefined HISTORY_GROWTH_SIZE
+  hist_begin_time = (char**)realloc(hist_begin_time, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(char*));
+  hist_end_time = (char**)realloc(hist_end_time, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(char*));
+  hist_command = (char**)realloc(hist_command, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(char*));
+  hist_status = (char*)realloc(hist_status, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(char));
+  hist_pid = (pid_t*)realloc(hist_pid, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(pid_t));
+  hist_state = (int*)realloc(hist_state, (hist_log_capacity+HISTORY_GROWTH_SIZE)*sizeof(int));
+
+  hist_log_capacity += HISTORY_GROWTH_SIZE;
+}
+
+/** echo - print out arguments to screen
+ **/
+void echo(char** input, FILE* out) {
+  int i;
+  for (i = 0; input[i] != NULL; i++) {
+    fprintf(out, "%s%s", input[i], input[i+1] != NULL ? " " : "\n");
+  }
+}
+
+/** cd - change current directory to new_dir
+ **/
+void cd(char** input) {
+  // use HOME for no arguments
+  if (num_args(input) == 0) {
+    if (chdir(HOME) == -1) {
+      fprintf(stderr, "%s: %s: No such file or directory.\n", CD_COMMAND, HOME);
+    }
+    return;
+  }
+
+  // check for bad syntax
+  if (num_args(input) > 1) {
+    fprintf(stderr, "%s: Too many arguments.\n", CD_COMMAND);
+    return;
+  }
+
+  // replace leading ~ with HOME path
+  char* new_dir = strdup(input[0]);
+  if (new_dir[0] == '~') {
+    swap_home(&new_dir);
+  }
+
+  if (access(new_dir, F_OK)) {
+    fprintf(stderr, "%s: %s: No such file or directory.\n", CD_COMMAND, new_dir);
+  } else if (chdir(new_dir) == -1 && errno == ENOTDIR) {
+    fprintf(stderr, "%s: %s: Not a directory.\n", CD_COMMAND, new_dir);
+    errno = 0;
+  }
+  free(new_dir);
+}
 
 /** which - show full path of executable if existant
  **/
-void which(char** input, int list_all) {
+void which(char** input, int list_all, FILE* out) {
   // check for no input
   if (num_args(input) == 0 ||
       (num_args(input) == 1 && list_all == 1)) {
@@ -671,8 +2294,19 @@ void which(char** input, int list_all) {
         strcmp(input[j], HISTORY_COMMAND) == 0 ||
         strcmp(input[j], CD_COMMAND) == 0 ||
         strcmp(input[j], ECHO_COMMAND) == 0 ||
-        strcmp(input[j], WHICH_COMMAND) == 0) {
-      printf("%s: Built-in command.\n", input[j]);
+        strcmp(input[j], WHICH_COMMAND) == 0 ||
+        strcmp(input[j], JOBSTAT_COMMAND) == 0 ||
+        strcmp(input[j], BENCH_COMMAND) == 0 ||
+        strcmp(input[j], ALIAS_COMMAND) == 0) {
+      fprintf(out, "%s: Built-in command.\n", input[j]);
+      continue;
+    }
+    if (find_alias(input[j]) != NULL) {
+      fprintf(out, "%s: Aliased to %s.\n", input[j], find_alias(input[j])->words[0]);
+      continue;
+    }
+    if (find_function(input[j]) != NULL) {
+      fprintf(out, "%s: Shell function.\n", input[j]);
       continue;
     }
 
@@ -686,7 +2320,7 @@ void which(char** input, int list_all) {
         continue;
       }
 
-      printf("%s\n", test_path);
+      fprintf(out, "%s\n", test_path);
       if (list_all == 0) {
         free(test_path);
         break;
@@ -705,8 +2339,8 @@ void swap_home(char** string) {
   temp = (char*)realloc(temp, (strlen(HOME)+strlen(good_input)+1)*sizeof(char));
   strcat(temp, good_input);
 
-  *string = strdup(temp);
-  free(temp);
+  free(*string);
+  *string = temp;
 }
 
 /** num_args - return number of arguments passed in
@@ -842,12 +2476,485 @@ void set_time(int time_slot, int index) {
   free(time_buffer);
 }
 
+/** replay - run recorded commands through the shell and report throughput
+ **/
+int replay(char* replay_file, int repeat) {
+  struct replay_line* lines = NULL;
+  struct timespec run_begin, run_end, begin, end;
+  struct rusage usage_self, usage_children;
+  int num_lines = 0;
+  int num_run = 0;
+  int line_num;
+  int pass;
+
+  if ((input_stream = fopen(replay_file, "re")) == NULL) {
+    perror(replay_file);
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &run_begin);
+  for (pass = 0; pass < repeat && stay_alive == 1; pass++) {
+    rewind(input_stream);
+    line_num = 0;
+
+    while (stay_alive == 1) {
+      clear_buffer();
+      check_jobs();
+
+      // time each command from parsing until it completes
+      clock_gettime(CLOCK_MONOTONIC, &begin);
+      if (read_input() == 0) {
+        break;
+      }
+      if (strlen(buffer) == 0) {
+        continue;
+      }
+      run_input();
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      // first pass records each command line
+      if (line_num == num_lines) {
+        lines = (struct replay_line*)realloc(lines, (num_lines+1)*sizeof(struct replay_line));
+        lines[num_lines].command = strdup(buffer);
+        lines[num_lines].latency = (double*)malloc(repeat*sizeof(double));
+        lines[num_lines].num_samples = 0;
+        num_lines++;
+      }
+      lines[line_num].latency[lines[line_num].num_samples++] =
+        (end.tv_sec-begin.tv_sec)*1e3 + (end.tv_nsec-begin.tv_nsec)/1e6;
+      line_num++;
+      num_run++;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &run_end);
+  fclose(input_stream);
+  input_stream = stdin;
+
+  // report on stderr so command output can be discarded separately
+  double elapsed = (run_end.tv_sec-run_begin.tv_sec) + (run_end.tv_nsec-run_begin.tv_nsec)/1e9;
+  getrusage(RUSAGE_SELF, &usage_self);
+  getrusage(RUSAGE_CHILDREN, &usage_children);
+
+  fprintf(stderr, "%s: %d commands in %.3fs (%.1f commands/sec) over %d passes\n",
+          NAME, num_run, elapsed, num_run/elapsed, pass);
+  fprintf(stderr, "%s: peak RSS %ldK shell, %ldK largest child\n",
+          NAME, usage_self.ru_maxrss, usage_children.ru_maxrss);
+  fprintf(stderr, "     p50 ms     p95 ms     p99 ms   Command\n");
+  for (line_num = 0; line_num < num_lines; line_num++) {
+    qsort(lines[line_num].latency, lines[line_num].num_samples, sizeof(double), &compare_double);
+    fprintf(stderr, " %10.3f %10.3f %10.3f   %s\n",
+            percentile(lines[line_num].latency, lines[line_num].num_samples, 50),
+            percentile(lines[line_num].latency, lines[line_num].num_samples, 95),
+            percentile(lines[line_num].latency, lines[line_num].num_samples, 99),
+            lines[line_num].command);
+    free(lines[line_num].command);
+    free(lines[line_num].latency);
+  }
+  free(lines);
+
+  return 0;
+}
+
+/** strip_history - reduce a line copied from history output to its command
+ **/
+void strip_history(char* line) {
+  char* field;
+
+  // skip header and comment lines entirely
+  if (strncmp(line, " PID ", 5) == 0 || line[0] == '#') {
+    line[0] = 0;
+    return;
+  }
+
+  // history lines look like "PID\t[S]   begin  end   command"
+  if (!isdigit(line[0]) || (field = strstr(line, "\t[")) == NULL ||
+      strspn(line, "0123456789") != field-line) {
+    return;
+  }
+  field += 5;
+  field += strspn(field, " ");
+  field += strcspn(field, " ");
+  field += strspn(field, " ");
+  field += strcspn(field, " ");
+  field += strspn(field, " ");
+  memmove(line, field, strlen(field)+1);
+}
+
+/** percentile - return pth percentile of sorted samples
+ **/
+double percentile(double* samples, int num_samples, double p) {
+  int index = (int)(p/100*num_samples+0.999999)-1;
+
+  if (num_samples == 0) {
+    return 0;
+  }
+  if (index < 0) {
+    index = 0;
+  }
+  return samples[index];
+}
+
+/** compare_double - order doubles for qsort
+ **/
+int compare_double(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/** serve - run commands sent by clients over a Unix domain socket
+ **/
+int serve(char* socket_path) {
+  struct sockaddr_un address;
+  struct epoll_event event, events[SERVE_MAX_EVENTS];
+  struct stat socket_info;
+  sigset_t serve_mask;
+  int fd_listen, fd_signal, fd_epoll;
+  int num_events;
+  int i;
+
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "%s: Socket path too long.\n", NAME);
+    return 1;
+  }
+
+  // replace a socket left behind by an earlier server, but never anything else
+  if (lstat(socket_path, &socket_info) == 0) {
+    if (!S_ISSOCK(socket_info.st_mode)) {
+      fprintf(stderr, "%s: %s exists and is not a socket.\n", NAME, socket_path);
+      return 1;
+    }
+    unlink(socket_path);
+  }
+
+  // children and shutdown requests arrive through a signalfd instead of handlers
+  sigemptyset(&serve_mask);
+  sigaddset(&serve_mask, SIGCHLD);
+  sigaddset(&serve_mask, SIGINT);
+  sigaddset(&serve_mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &serve_mask, NULL);
+  fd_signal = signalfd(-1, &serve_mask, SFD_CLOEXEC);
+
+  // message boundaries keep one command line per request
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+  fd_listen = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+  if (fd_listen == -1 ||
+      bind(fd_listen, (struct sockaddr*)&address, sizeof(address)) == -1 ||
+      listen(fd_listen, SOMAXCONN) == -1) {
+    perror(socket_path);
+    return 1;
+  }
+
+  fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_listen, &event);
+  event.data.ptr = &fd_signal;
+  epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_signal, &event);
+
+  while (stay_alive == 1) {
+    num_events = epoll_wait(fd_epoll, events, SERVE_MAX_EVENTS, -1);
+
+    for (i = 0; i < num_events; i++) {
+      // accept new client
+      if (events[i].data.ptr == NULL) {
+        struct client* client = (struct client*)malloc(sizeof(struct client));
+        client->fd = accept4(fd_listen, NULL, NULL, SOCK_CLOEXEC);
+        client->pid = -1;
+        client->hist_index = -1;
+        if (client->fd == -1) {
+          free(client);
+          continue;
+        }
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        epoll_ctl(fd_epoll, EPOLL_CTL_ADD, client->fd, &event);
+
+        clients = (struct client**)realloc(clients, (num_clients+1)*sizeof(struct client*));
+        clients[num_clients++] = client;
+        continue;
+      }
+
+      // reap finished children or shut down
+      if (events[i].data.ptr == &fd_signal) {
+        struct signalfd_siginfo info;
+        while (read(fd_signal, &info, sizeof(info)) == sizeof(info)) {
+          if (info.ssi_signo != SIGCHLD) {
+            stay_alive = 0;
+          }
+          serve_reap();
+          break;
+        }
+        continue;
+      }
+
+      // run request or drop disconnected client
+      struct client* client = (struct client*)events[i].data.ptr;
+      if (serve_request(client) == -1) {
+        epoll_ctl(fd_epoll, EPOLL_CTL_DEL, client->fd, NULL);
+        close_client(client);
+      }
+    }
+  }
+
+  while (num_clients > 0) {
+    close_client(clients[0]);
+  }
+  close(fd_epoll);
+  close(fd_listen);
+  close(fd_signal);
+  unlink(socket_path);
+  return 0;
+}
+
+/** serve_request - receive command and client fds, then start it
+ **/
+int serve_request(struct client* client) {
+  char line[BUFFER_SIZE+1];
+  char control[CMSG_SPACE(3*sizeof(int))];
+  struct iovec data = { line, BUFFER_SIZE };
+  struct msghdr message;
+  struct cmsghdr* header;
+  int fds[3];
+  ssize_t length;
+
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  if ((length = recvmsg(client->fd, &message, MSG_CMSG_CLOEXEC)) <= 0) {
+    return -1;
+  }
+  line[length] = 0;
+
+  // client must hand over its stdin, stdout and stderr with every request
+  header = CMSG_FIRSTHDR(&message);
+  if (header == NULL || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+      header->cmsg_len != CMSG_LEN(3*sizeof(int)) || (message.msg_flags & MSG_CTRUNC)) {
+    fprintf(stderr, "%s: Request without stdio fds.\n", NAME);
+    close_rights(&message);
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(header), 3*sizeof(int));
+
+  // one request at a time per client
+  if (client->pid != -1) {
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+    return -1;
+  }
+
+  // a request is one line of at most BUFFER_SIZE-1 bytes, never run part of a longer one
+  if ((message.msg_flags & MSG_TRUNC) || length > BUFFER_SIZE-1) {
+    int status = 2;
+    dprintf(fds[2], "%s: Request longer than %d bytes.\n", NAME, BUFFER_SIZE-1);
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+    send(client->fd, &status, sizeof(int), MSG_NOSIGNAL);
+    return 0;
+  }
+
+  // commands write straight to the client's fds, nothing is copied through us
+  fflush(stdout);
+  dup2(fds[0], 0);
+  dup2(fds[1], 1);
+  dup2(fds[2], 2);
+  close(fds[0]);
+  close(fds[1]);
+  close(fds[2]);
+
+  clear_buffer();
+  input_stream = fmemopen(line, length, "r");
+  read_input();
+  fclose(input_stream);
+  input_stream = stdin;
+
+  int status = 0;
+  int hist_index = hist_log_size;
+  if (strlen(buffer) == 0) {
+    status = 0;
+  } else if (iter_status == 1) {
+    status = 1;
+  } else if (serve_blocks()) {
+    // answered by serve_reap once the copy of the shell running it exits
+    if ((client->pid = serve_spawn()) == -1) {
+      status = 1;
+    } else {
+      client->hist_index = hist_log_size-1;
+    }
+  } else {
+    execute(1);
+    stay_alive = 1;
+
+    // exit adds no history entry and leaves nothing to wait for
+    if (hist_log_size > hist_index) {
+      // wait for the final command unless it already finished or was sent to the background
+      if (hist_pid[hist_log_size-1] != pid_self && iter_status == 0) {
+        client->pid = hist_pid[hist_log_size-1];
+        client->hist_index = hist_log_size-1;
+      }
+      status = WEXITSTATUS(hist_state[hist_log_size-1]);
+    }
+  }
+
+  // return stdio to default
+  fflush(stdout);
+  dup2(keep_input, 0);
+  dup2(keep_output, 1);
+  dup2(keep_error, 2);
+
+  if (client->pid == -1) {
+    send(client->fd, &status, sizeof(int), MSG_NOSIGNAL);
+  }
+  return 0;
+}
+
+/** serve_blocks - check if request would write to client fds from the server itself
+ **/
+int serve_blocks() {
+  int command_num;
+
+  if (iter_status == 3) {
+    return 1;
+  }
+  for (command_num = 0; command_num < num_commands; command_num++) {
+    if (strcmp(command[command_num], EXIT_COMMAND) == 0) {
+      return 0;
+    }
+  }
+
+  // only a lone cd or alias definition changes the server, and neither writes more than an error
+  if (num_commands == 1 && (strcmp(command[0], CD_COMMAND) == 0 ||
+      (strcmp(command[0], ALIAS_COMMAND) == 0 && command_args[0][0] != NULL))) {
+    return 0;
+  }
+
+  // built-ins and functions write from this process, one slow reader would stall every client
+  for (command_num = 0; command_num < num_commands; command_num++) {
+    if (is_builtin(command[command_num]) || find_function(command[command_num]) != NULL) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** serve_spawn - run request in a copy of the shell and log it, return its pid
+ **/
+pid_t serve_spawn() {
+  pid_t pid;
+  int i;
+
+  fflush(stdout);
+  if ((pid = fork()) == -1) {
+    perror(NAME);
+    return -1;
+  }
+
+  if (pid == 0) {
+    // the copy only talks to its client through the stdio fds it already has
+    sigprocmask(SIG_SETMASK, &child_mask, NULL);
+    for (i = 0; i < num_clients; i++) {
+      close(clients[i]->fd);
+    }
+    if (iter_status == 3) {
+      execute_loop();
+    } else {
+      execute(iter_status == 2);
+    }
+    fflush(stdout);
+    _exit(WEXITSTATUS(hist_state[hist_log_size-1]));
+  }
+
+  // cd, alias and history changes made by the request stay in the copy
+  set_time(BEGIN_SLOT, hist_log_size);
+  hist_command[hist_log_size] = strdup(buffer);
+  hist_end_time[hist_log_size] = "--:--";
+  hist_pid[hist_log_size] = pid;
+  hist_state[hist_log_size] = 0;
+  hist_log_size++;
+  if (iter_status == 3) {
+    free_loop(current_loop);
+    current_loop = NULL;
+  }
+  return pid;
+}
+
+/** close_rights - close every fd passed along with a rejected message
+ **/
+void close_rights(struct msghdr* message) {
+  struct cmsghdr* header;
+  int* fds;
+  int i;
+
+  for (header = CMSG_FIRSTHDR(message); header != NULL; header = CMSG_NXTHDR(message, header)) {
+    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    fds = (int*)CMSG_DATA(header);
+    for (i = 0; i < (int)((header->cmsg_len-CMSG_LEN(0))/sizeof(int)); i++) {
+      close(fds[i]);
+    }
+  }
+}
+
+/** serve_reap - collect finished children and answer their clients
+ **/
+void serve_reap() {
+  pid_t pid;
+  int status;
+  int i;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    // finished background jobs only need their history entry completed
+    for (i = hist_log_size-1; i >= 0; i--) {
+      if (hist_pid[i] == pid && hist_status[i] == 'R') {
+        hist_state[i] = status;
+        set_time(END_SLOT, i);
+        break;
+      }
+    }
+
+    for (i = 0; i < num_clients; i++) {
+      if (clients[i]->pid == pid) {
+        int exit_code = WIFSIGNALED(status) ? 128+WTERMSIG(status) : WEXITSTATUS(status);
+        send(clients[i]->fd, &exit_code, sizeof(int), MSG_NOSIGNAL);
+        clients[i]->pid = -1;
+        clients[i]->hist_index = -1;
+        break;
+      }
+    }
+  }
+}
+
+/** close_client - disconnect client and forget it
+ **/
+void close_client(struct client* client) {
+  int i;
+
+  for (i = 0; i < num_clients; i++) {
+    if (clients[i] == client) {
+      clients[i] = clients[--num_clients];
+      break;
+    }
+  }
+  close(client->fd);
+  free(client);
+}
+
 /** kill_child - kill child after its completion
  **/
 void kill_child() {
+  int saved_errno = errno;
   int status;
 
-  // kill child and reset signal
-  waitpid(0, &status, WNOHANG);
+  // kill every finished child and reset signal, the last waitpid always sets errno
+  while (waitpid(0, &status, WNOHANG) > 0) {}
   signal(SIGCHLD, &kill_child);
+  errno = saved_errno;
 }